@@ -1,23 +1,215 @@
 #include "AST.hpp"
+#include "variables.hpp"
+#include "functions.hpp"
+#include "transfer.hpp"
+#include "memo.hpp"
 #include <string>
 #include <sstream>
 #include <memory>
 #include <unistd.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <cerrno>
 #include <iostream>
 
+static void trace_transfer(const std::string &command, const TransferResult &result) {
+    if (tracing_enabled()) {
+        std::cerr << "kash: " << command << ": " << result.bytes << " bytes via " << result.method << std::endl;
+    }
+}
+
+// Find the index of the "))" that closes an arithmetic expansion starting at start
+static size_t find_arithmetic_end(const std::string &word, size_t start) {
+    int depth = 0;
+    for (size_t i = start; i < word.size(); i++) {
+        if (word[i] == '(') {
+            depth++;
+        } else if (word[i] == ')') {
+            if (depth == 0) {
+                return (i + 1 < word.size() && word[i + 1] == ')') ? i : std::string::npos;
+            }
+            depth--;
+        }
+    }
+    return std::string::npos;
+}
+
+// Expand $((expr)), ${name} and $name in a word.
+// Returns false if an arithmetic expansion failed.
+static bool expand_word(const std::string &word, std::string &result) {
+    result.clear();
+    size_t i = 0;
+
+    while (i < word.size()) {
+        size_t dollar = word.find('$', i);
+        result.append(word, i, dollar == std::string::npos ? std::string::npos : dollar - i);
+        if (dollar == std::string::npos) {
+            break;
+        }
+        i = dollar + 1;
+
+        if (word.compare(i, 2, "((") == 0) {
+            size_t end = find_arithmetic_end(word, i + 2);
+            if (end == std::string::npos) {
+                std::cerr << "kash: unterminated arithmetic expansion" << std::endl;
+                return false;
+            }
+
+            long long value;
+            // The text inside $(( )) comes straight from the input, so it can be cached
+            const ArithmeticExpression *expr = compile_arithmetic(word.substr(i + 2, end - i - 2));
+            if (expr == nullptr || !expr->evaluate(value)) {
+                return false;
+            }
+            result += std::to_string(value);
+            i = end + 2;
+        } else if (i < word.size() && word[i] == '{') {
+            size_t end = word.find('}', i);
+            if (end == std::string::npos) {
+                std::cerr << "kash: bad substitution" << std::endl;
+                return false;
+            }
+
+            const std::string *value = get_variable(word.substr(i + 1, end - i - 1));
+            if (value != nullptr) {
+                result += *value;
+            }
+            i = end + 1;
+        } else if (i < word.size() && isdigit(static_cast<unsigned char>(word[i]))) {
+            // Positional parameter, $0 is the shell itself like in bash
+            size_t index = word[i] - '0';
+            const std::vector<std::string> &positional = positional_parameters();
+            if (index == 0) {
+                result += "kash";
+            } else if (index < positional.size()) {
+                result += positional[index];
+            }
+            i++;
+        } else if (i < word.size() && word[i] == '#') {
+            const std::vector<std::string> &positional = positional_parameters();
+            result += std::to_string(positional.empty() ? 0 : positional.size() - 1);
+            i++;
+        } else if (i < word.size() && (word[i] == '@' || word[i] == '*')) {
+            const std::vector<std::string> &positional = positional_parameters();
+            for (size_t j = 1; j < positional.size(); j++) {
+                if (j > 1) {
+                    result += ' ';
+                }
+                result += positional[j];
+            }
+            i++;
+        } else {
+            size_t end = i;
+            while (end < word.size() && (isalnum(static_cast<unsigned char>(word[end])) || word[end] == '_')) {
+                end++;
+            }
+
+            if (end == i) {
+                // A lone $ is kept as-is
+                result += '$';
+                continue;
+            }
+
+            const std::string *value = get_variable(word.substr(i, end - i));
+            if (value != nullptr) {
+                result += *value;
+            }
+            i = end;
+        }
+    }
+
+    return true;
+}
+
+static bool expand_arguments(const std::vector<std::string> &args, std::vector<std::string> &expanded) {
+    expanded.clear();
+    expanded.reserve(args.size());
+    for (const auto &arg : args) {
+        if (arg.find('$') == std::string::npos) {
+            expanded.push_back(arg);
+        } else if (arg == "$@" || arg == "$*") {
+            // Each positional parameter becomes its own argument
+            const std::vector<std::string> &positional = positional_parameters();
+            if (positional.size() > 1) {
+                expanded.insert(expanded.end(), positional.begin() + 1, positional.end());
+            }
+        } else {
+            expanded.emplace_back();
+            if (!expand_word(arg, expanded.back())) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int exit_status(int wait_status) {
+    if (WIFEXITED(wait_status))
+        return WEXITSTATUS(wait_status);
+    if (WIFSIGNALED(wait_status))
+        return 128 + WTERMSIG(wait_status);
+    if (WIFSTOPPED(wait_status))
+        return 128 + WSTOPSIG(wait_status);
+    return wait_status;
+}
+
+int wait_for_child(pid_t pid, int options) {
+    int status = 0;
+    while (waitpid(pid, &status, options) == -1) {
+        if (errno != EINTR) {
+            perror("waitpid failed");
+            return EXIT_FAILURE << 8;
+        }
+    }
+    return status;
+}
+
 int CommandNode::execute() {
     if (args.empty())
         // Nothing to do
         return EXIT_SUCCESS;
 
+    std::vector<std::string> expanded;
+    if (!expand_arguments(args, expanded))
+        return EXIT_FAILURE;
+
+    return run(expanded, false);
+}
+
+int CommandNode::executeLast() {
+    std::vector<std::string> expanded;
+    if (!expand_arguments(args, expanded))
+        return EXIT_FAILURE;
+
+    return run(expanded, true);
+}
+
+int CommandNode::run(std::vector<std::string> &expanded, bool last) {
+    if (expanded.empty())
+        return EXIT_SUCCESS;
+
+    // Functions run in-process, only external commands need a fork
+    std::shared_ptr<Node> function = find_function(expanded[0]);
+    if (function)
+        return call_function(function, expanded);
+
     std::vector<char *> c_args;
-    for (const auto &arg : args) {
+    for (const auto &arg : expanded) {
         c_args.push_back(const_cast<char *>(arg.c_str()));
     }
 
     // Add a null pointer to the end of the array (required by execvp)
     c_args.push_back(nullptr);
 
+    if (last) {
+        // Nothing is left for this process to do, so become the command instead of forking it
+        std::cout.flush();
+        execvp(c_args[0], c_args.data());
+        perror("execvp failed");
+        exit(EXIT_FAILURE);
+    }
+
     // Fork a child process
     pid_t pid = fork();
 
@@ -32,13 +224,47 @@ int CommandNode::execute() {
         exit(EXIT_FAILURE);
     } else {
         // Parent process
-        int status;
-        waitpid(pid, &status, WUNTRACED);
-        return status;
+        return exit_status(wait_for_child(pid, WUNTRACED));
     }
 }
 
 int BuiltinCommandNode::execute() {
+    std::vector<std::string> args;
+    if (!expand_arguments(this->args, args))
+        return EXIT_FAILURE;
+
+    // cat and tee run for as long as their input lasts, so they get a process of
+    // their own that Ctrl-C can interrupt like any other command
+    if (args[0] == "cat" || args[0] == "tee") {
+        std::cout.flush();
+        pid_t pid = fork();
+
+        if (pid == -1) {
+            perror("fork failed");
+            return EXIT_FAILURE;
+        } else if (pid == 0) {
+            // Child process
+            signal(SIGINT, SIG_DFL);
+            exit(run(args, true));
+        }
+
+        // Only parent process should reach this code
+        return exit_status(wait_for_child(pid, WUNTRACED));
+    }
+
+    return run(args, false);
+}
+
+int BuiltinCommandNode::executeLast() {
+    // Already in a process of its own, nothing else to fork
+    std::vector<std::string> args;
+    if (!expand_arguments(this->args, args))
+        return EXIT_FAILURE;
+
+    return run(args, true);
+}
+
+int BuiltinCommandNode::run(std::vector<std::string> &args, bool last) {
     if (args[0] == "cd") {
         if (args.size() == 1) {
             // No arguments to cd, go to home directory
@@ -55,6 +281,123 @@ int BuiltinCommandNode::execute() {
 
     } else if (args[0] == "exit") {
         return EXIT_SUCCESS;
+
+    } else if (args[0] == "let") {
+        if (args.size() == 1) {
+            std::cerr << "let: expression expected" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        // Each argument is a separate expression, the last one decides the status
+        long long value = 0;
+        bool unexpanded = this->args.size() == args.size();
+        for (size_t i = 1; i < args.size(); i++) {
+            // Arguments written without any expansions are the same every time, so they
+            // can use the cache. Anything else is new text and gets compiled and discarded.
+            bool ok;
+            if (unexpanded && this->args[i].find('$') == std::string::npos) {
+                const ArithmeticExpression *expr = compile_arithmetic(args[i]);
+                ok = expr != nullptr && expr->evaluate(value);
+            } else {
+                ok = evaluate_arithmetic(args[i], value);
+            }
+
+            if (!ok) {
+                return EXIT_FAILURE;
+            }
+        }
+
+        return value != 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    } else if (args[0] == "cat" || args[0] == "tee") {
+        // Only the plain forms are builtin, anything with options goes to the real command
+        for (size_t i = 1; i < args.size(); i++) {
+            if (args[i].size() > 1 && args[i][0] == '-') {
+                return CommandNode::run(args, last);
+            }
+        }
+
+        std::cout.flush();
+        int status = EXIT_SUCCESS;
+
+        if (args[0] == "tee") {
+            std::vector<int> files;
+            for (size_t i = 1; i < args.size(); i++) {
+                int fd = open(args[i].c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+                if (fd == -1) {
+                    perror(("tee: " + args[i]).c_str());
+                    status = EXIT_FAILURE;
+                } else {
+                    files.push_back(fd);
+                }
+            }
+
+            TransferResult result = tee_fd(STDIN_FILENO, STDOUT_FILENO, files);
+            trace_transfer("tee", result);
+            for (int fd : files) {
+                close(fd);
+            }
+            return result.failed ? EXIT_FAILURE : status;
+        }
+
+        if (args.size() == 1) {
+            args.push_back("-");
+        }
+
+        for (size_t i = 1; i < args.size(); i++) {
+            int fd = args[i] == "-" ? STDIN_FILENO : open(args[i].c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd == -1) {
+                perror(("cat: " + args[i]).c_str());
+                status = EXIT_FAILURE;
+                continue;
+            }
+
+            TransferResult result = transfer_fd(fd, STDOUT_FILENO);
+            trace_transfer("cat " + args[i], result);
+            if (result.failed) {
+                perror(("cat: " + args[i]).c_str());
+                status = EXIT_FAILURE;
+            }
+
+            if (fd != STDIN_FILENO) {
+                close(fd);
+            }
+        }
+
+        return status;
+
+    } else if (args[0] == "memo") {
+        return memo_command(args);
+
+    } else if (args[0] == "local") {
+        if (!in_variable_scope()) {
+            std::cerr << "local: can only be used in a function" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        for (size_t i = 1; i < args.size(); i++) {
+            size_t equals = args[i].find('=');
+            std::string name = args[i].substr(0, equals);
+            if (!is_valid_variable_name(name)) {
+                std::cerr << "local: '" << args[i] << "': not a valid identifier" << std::endl;
+                return EXIT_FAILURE;
+            }
+
+            make_local_variable(name);
+            set_variable(name, equals == std::string::npos ? std::string() : args[i].substr(equals + 1));
+        }
+
+        return EXIT_SUCCESS;
+
+    } else if (args[0] == "return") {
+        if (!in_variable_scope()) {
+            std::cerr << "return: can only be used in a function" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        int status = args.size() > 1 ? atoi(args[1].c_str()) & 0xff : EXIT_SUCCESS;
+        request_return(status);
+        return status;
     }
 
     return EXIT_FAILURE;
@@ -62,20 +405,38 @@ int BuiltinCommandNode::execute() {
 
 int AndNode::execute() {
     int status = left->execute();
+    if (return_pending())
+        return status;
     if (status == EXIT_SUCCESS) {
         status = right->execute();
     }
     return status;
 }
 
+int AndNode::executeLast() {
+    int status = left->execute();
+    if (return_pending() || status != EXIT_SUCCESS)
+        return status;
+    return right->executeLast();
+}
+
 int OrNode::execute() {
     int status = left->execute();
+    if (return_pending())
+        return status;
     if (status != EXIT_SUCCESS) {
         status = right->execute();
     }
     return status;
 }
 
+int OrNode::executeLast() {
+    int status = left->execute();
+    if (return_pending() || status == EXIT_SUCCESS)
+        return status;
+    return right->executeLast();
+}
+
 int PipelineNode::execute() {
     int pipefd[2];
     if (pipe(pipefd) == -1) {
@@ -83,6 +444,25 @@ int PipelineNode::execute() {
         return EXIT_FAILURE;
     }
 
+    // A bigger pipe buffer means fewer context switches for bulk data
+    const std::string *pipe_size = get_variable("KASH_PIPE_SIZE");
+    if (pipe_size != nullptr && !pipe_size->empty()) {
+        char *end;
+        errno = 0;
+        long requested = strtol(pipe_size->c_str(), &end, 10);
+
+        if (errno != 0 || *end != '\0' || requested <= 0) {
+            std::cerr << "kash: KASH_PIPE_SIZE: '" << *pipe_size << "' is not a positive number of bytes" << std::endl;
+        } else {
+            long capacity = set_pipe_capacity(pipefd[1], requested);
+            if (capacity == -1) {
+                perror("setting pipe size failed");
+            } else if (tracing_enabled()) {
+                std::cerr << "kash: pipe capacity " << capacity << " bytes" << std::endl;
+            }
+        }
+    }
+
     pid_t left_pid = fork();
 
     if (left_pid == -1) {
@@ -90,11 +470,12 @@ int PipelineNode::execute() {
         return EXIT_FAILURE;
     } else if (left_pid == 0) {
         // In the child process (left side of the pipeline)
+        signal(SIGINT, SIG_DFL); // Only the interactive shell itself ignores Ctrl-C
         close(pipefd[0]); // Close the unused read end
         dup2(pipefd[1], STDOUT_FILENO); // Redirect stdout to the write end of the pipe
         close(pipefd[1]); // Close the write end after it's duplicated
 
-        int status = left->execute();
+        int status = left->executeLast();
         exit(status); // Exit with the status from the left side command
     }
 
@@ -106,11 +487,12 @@ int PipelineNode::execute() {
         return EXIT_FAILURE;
     } else if (right_pid == 0) {
         // In the child process (right side of the pipeline)
+        signal(SIGINT, SIG_DFL); // Only the interactive shell itself ignores Ctrl-C
         close(pipefd[1]); // Close the unused write end
         dup2(pipefd[0], STDIN_FILENO); // Redirect stdin to the read end of the pipe
         close(pipefd[0]); // Close the read end after it's duplicated
 
-        int status = right->execute();
+        int status = right->executeLast();
         exit(status); // Exit with the status from the right side command
     }
 
@@ -118,19 +500,27 @@ int PipelineNode::execute() {
     close(pipefd[0]); // Parent doesn't use the read end
     close(pipefd[1]); // Parent doesn't use the write end
 
-    int status;
-    waitpid(left_pid, &status, 0); // Wait for the left side to finish
-    waitpid(right_pid, &status, 0); // Then wait for the right side to finish
+    wait_for_child(left_pid, 0); // Wait for the left side to finish
+    int status = wait_for_child(right_pid, 0); // Then wait for the right side to finish
 
-    return status; // Return the status of the last command in the pipeline
+    return exit_status(status); // Return the status of the last command in the pipeline
 }
 
 int SequenceNode::execute() {
     int status = left->execute();
+    if (return_pending())
+        return status;
     status = right->execute();
     return status;
 }
 
+int SequenceNode::executeLast() {
+    int status = left->execute();
+    if (return_pending())
+        return status;
+    return right->executeLast();
+}
+
 int SubshellNode::execute() {
     pid_t pid = fork();
 
@@ -139,22 +529,81 @@ int SubshellNode::execute() {
         return EXIT_FAILURE;
     } else if (pid == 0) {
         // In the child process
-        int status = child->execute();
+        signal(SIGINT, SIG_DFL); // Only the interactive shell itself ignores Ctrl-C
+        int status = child->executeLast();
         exit(status); // Exit with the status from the child
     }
 
     // Only parent process should reach this code
-    int status;
-    waitpid(pid, &status, 0); // Wait for the child to finish
-    return status;
+    return exit_status(wait_for_child(pid, 0)); // Wait for the child to finish
+}
+
+int SubshellNode::executeLast() {
+    // This process is about to exit anyway, so it can be the subshell itself
+    return child->executeLast();
+}
+
+// Open the file and point the redirected descriptors at it
+bool RedirectionNode::redirect() {
+    static const int flags[] = {
+        O_RDONLY,                       // <
+        O_WRONLY | O_CREAT | O_TRUNC,   // >
+        O_WRONLY | O_CREAT | O_APPEND,  // >>
+        O_WRONLY | O_CREAT | O_TRUNC,   // 2>
+        O_WRONLY | O_CREAT | O_APPEND,  // 2>>
+        O_WRONLY | O_CREAT | O_TRUNC,   // &>
+        O_WRONLY | O_CREAT | O_APPEND   // &>>
+    };
+
+    int fd = open(filename.c_str(), flags[redirectType], 0666);
+    if (fd == -1) {
+        perror(("kash: " + filename).c_str());
+        return false;
+    }
+
+    std::cout.flush();
+    if (redirectType == 0) {
+        dup2(fd, STDIN_FILENO);
+    } else if (redirectType == 1 || redirectType == 2) {
+        dup2(fd, STDOUT_FILENO);
+    } else if (redirectType == 3 || redirectType == 4) {
+        dup2(fd, STDERR_FILENO);
+    } else {
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+    }
+    close(fd);
+
+    return true;
 }
 
 int RedirectionNode::execute() {
-    std::cout << "RedirectionNode::execute() not implemented" << std::endl;
-    int status = child->execute();
+    // Keep copies of the shell's own descriptors to put back afterwards
+    int saved[3];
+    for (int fd = 0; fd < 3; fd++) {
+        saved[fd] = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+    }
+
+    int status = redirect() ? child->execute() : EXIT_FAILURE;
+
+    std::cout.flush();
+    for (int fd = 0; fd < 3; fd++) {
+        if (saved[fd] != -1) {
+            dup2(saved[fd], fd);
+            close(saved[fd]);
+        }
+    }
+
     return status;
 }
 
+int RedirectionNode::executeLast() {
+    // Nothing runs after this, so there's nothing to restore
+    if (!redirect())
+        return EXIT_FAILURE;
+    return child->executeLast();
+}
+
 int BackgroundNode::execute() {
     std::cout << "BackgroundNode::execute() not implemented" << std::endl;
     int status = child->execute();
@@ -167,7 +616,11 @@ int NegateNode::execute() {
 }
 
 int AssignmentNode::execute() {
-    std::cout << "AssignmentNode::execute() not implemented" << std::endl;
+    std::string expanded;
+    if (!expand_word(val, expanded))
+        return EXIT_FAILURE;
+
+    set_variable(var, expanded);
     return EXIT_SUCCESS;
 }
 
@@ -175,3 +628,24 @@ int CommandSubstitutionNode::execute() {
     std::cout << "CommandSubstitutionNode::execute() not implemented" << std::endl;
     return EXIT_SUCCESS;
 }
+
+int ArithmeticNode::execute() {
+    // Compile on first use, later runs go straight to evaluation
+    if (compiled == nullptr) {
+        compiled = compile_arithmetic(expression);
+        if (compiled == nullptr)
+            return EXIT_FAILURE;
+    }
+
+    long long value;
+    if (!compiled->evaluate(value))
+        return EXIT_FAILURE;
+
+    // Like bash, (( )) succeeds when the expression is non-zero
+    return value != 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int FunctionDefinitionNode::execute() {
+    define_function(name, body, source);
+    return EXIT_SUCCESS;
+}
@@ -1,13 +1,27 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <memory>
+#include <sys/types.h>
+#include "arithmetic.hpp"
 
 class Node {
     public:
         virtual ~Node() {}
         virtual int execute() = 0;
+
+        // Execute as the last thing this process will ever do. External commands
+        // are exec'd in place instead of forked, so this may not return.
+        virtual int executeLast() { return execute(); }
 };
 
+// Convert a status from waitpid into a shell exit status (0-255), so every
+// node reports statuses the same way builtins do
+int exit_status(int wait_status);
+
+// waitpid that retries when the shell's SIGINT handler interrupts it
+int wait_for_child(pid_t pid, int options);
+
 // A command like ls, cat, etc.
 class CommandNode : public Node {
     private:
@@ -15,6 +29,11 @@ class CommandNode : public Node {
     public:
         CommandNode(const std::vector<std::string> &args) : args(args) {}
         virtual int execute() override;
+        virtual int executeLast() override;
+
+        // Run a command whose arguments have already been expanded. With last set,
+        // external commands are exec'd in place of the current process.
+        static int run(std::vector<std::string> &expanded, bool last);
 
 };
 
@@ -22,9 +41,12 @@ class CommandNode : public Node {
 class BuiltinCommandNode : public Node {
     private:
         std::vector<std::string> args;
+
+        int run(std::vector<std::string> &expanded, bool last);
     public:
         BuiltinCommandNode(const std::vector<std::string> &args) : args(args) {}
         virtual int execute() override;
+        virtual int executeLast() override;
 };
 
 // | operator
@@ -48,6 +70,7 @@ class AndNode : public Node {
     public:
         AndNode(std::unique_ptr<Node> left, std::unique_ptr<Node> right) : left(std::move(left)), right(std::move(right)) {}
         virtual int execute() override;
+        virtual int executeLast() override;
         void setRightChild(std::unique_ptr<Node> right) {
             this->right = std::move(right);
         }
@@ -61,6 +84,7 @@ class OrNode : public Node {
     public:
         OrNode(std::unique_ptr<Node> left, std::unique_ptr<Node> right) : left(std::move(left)), right(std::move(right)) {}
         virtual int execute() override;
+        virtual int executeLast() override;
         void setRightChild(std::unique_ptr<Node> right) {
             this->right = std::move(right);
         }
@@ -74,6 +98,7 @@ class SequenceNode : public Node {
     public:
         SequenceNode(std::unique_ptr<Node> left, std::unique_ptr<Node> right) : left(std::move(left)), right(std::move(right)) {}
         virtual int execute() override;
+        virtual int executeLast() override;
         void setRightChild(std::unique_ptr<Node> right) {
             this->right = std::move(right);
         }
@@ -82,22 +107,26 @@ class SequenceNode : public Node {
 // A node that represents a subshell
 class SubshellNode : public Node {
     private:
-        Node *child;
+        std::unique_ptr<Node> child;
     public:
-        SubshellNode(Node *child) : child(child) {}
+        SubshellNode(std::unique_ptr<Node> child) : child(std::move(child)) {}
         virtual int execute() override;
+        virtual int executeLast() override;
 };
 
 // A node that represents a redirection
 class RedirectionNode : public Node {
     private:
-        Node *child;
+        std::unique_ptr<Node> child;
         std::string filename;
         int redirectType; // 0 = <, 1 = >, 2 = >>, 3 = 2>, 4 = 2>>, 5 = &>, 6 = &>>
+
+        bool redirect();
     public:
-        RedirectionNode(Node *child, const std::string &filename, int redirectType) : 
-            child(child), filename(filename), redirectType(redirectType) {}
+        RedirectionNode(std::unique_ptr<Node> child, const std::string &filename, int redirectType) : 
+            child(std::move(child)), filename(filename), redirectType(redirectType) {}
         virtual int execute() override;
+        virtual int executeLast() override;
 };
 
 // A node that represents a background process
@@ -136,3 +165,25 @@ class CommandSubstitutionNode : public Node {
         CommandSubstitutionNode(Node *child) : child(child) {}
         virtual int execute() override;
 };
+
+// A node that represents an arithmetic command like (( i++ ))
+class ArithmeticNode : public Node {
+    private:
+        std::string expression;
+        const ArithmeticExpression *compiled = nullptr;
+    public:
+        ArithmeticNode(const std::string &expression) : expression(expression) {}
+        virtual int execute() override;
+};
+
+// A node that represents a function definition like name() { ... }
+class FunctionDefinitionNode : public Node {
+    private:
+        std::string name;
+        std::shared_ptr<Node> body;
+        std::string source; // The body as written, so callers can tell definitions apart
+    public:
+        FunctionDefinitionNode(const std::string &name, std::unique_ptr<Node> body, const std::string &source) :
+            name(name), body(std::move(body)), source(source) {}
+        virtual int execute() override;
+};
@@ -0,0 +1,587 @@
+#include "arithmetic.hpp"
+#include "variables.hpp"
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <iostream>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+// Recursive descent parser that builds an ArithmeticExpression.
+// Precedence follows C (and bash), from lowest to highest:
+//   ,  = op=  ?:  ||  &&  |  ^  &  == !=  < <= > >=  << >>  + -  * / %  **  unary  postfix
+class ArithmeticParser {
+    private:
+        const std::string &source;
+        size_t pos = 0;
+        ArithmeticExpression &expr;
+        bool failed = false;
+
+        void skip_whitespace() {
+            while (pos < source.size() && isspace(static_cast<unsigned char>(source[pos]))) {
+                pos++;
+            }
+        }
+
+        // Consume token if it is next in the input
+        bool accept(const char *token) {
+            skip_whitespace();
+            size_t length = strlen(token);
+            if (source.compare(pos, length, token) != 0) {
+                return false;
+            }
+            pos += length;
+            return true;
+        }
+
+        // Like accept, but fails if the token is immediately followed by one of the
+        // given characters (so that "<" doesn't match the start of "<<" or "<=")
+        bool accept_not_followed(const char *token, const char *followers) {
+            skip_whitespace();
+            size_t length = strlen(token);
+            if (source.compare(pos, length, token) != 0) {
+                return false;
+            }
+            if (pos + length < source.size() && strchr(followers, source[pos + length]) != nullptr) {
+                return false;
+            }
+            pos += length;
+            return true;
+        }
+
+        int error(const std::string &message) {
+            if (!failed) {
+                std::cerr << "kash: " << source << ": " << message << std::endl;
+            }
+            failed = true;
+            return -1;
+        }
+
+        int add(ArithmeticOp op) {
+            expr.ops.push_back(op);
+            return static_cast<int>(expr.ops.size()) - 1;
+        }
+
+        int add_binary(ArithmeticOp::Operator op, int lhs, int rhs) {
+            ArithmeticOp node{ArithmeticOp::Binary};
+            node.op = op;
+            node.lhs = lhs;
+            node.rhs = rhs;
+            return add(node);
+        }
+
+        int intern_name(const std::string &name) {
+            for (size_t i = 0; i < expr.names.size(); i++) {
+                if (expr.names[i] == name) {
+                    return static_cast<int>(i);
+                }
+            }
+            expr.names.push_back(name);
+            return static_cast<int>(expr.names.size()) - 1;
+        }
+
+        int parse_comma() {
+            int lhs = parse_assignment();
+            while (!failed && accept(",")) {
+                lhs = add_binary(ArithmeticOp::Comma, lhs, parse_assignment());
+            }
+            return lhs;
+        }
+
+        int parse_assignment() {
+            int lhs = parse_ternary();
+            if (failed) {
+                return -1;
+            }
+
+            static const struct { const char *token; ArithmeticOp::Operator op; } assignments[] = {
+                {"<<=", ArithmeticOp::ShiftLeft}, {">>=", ArithmeticOp::ShiftRight},
+                {"+=", ArithmeticOp::Add}, {"-=", ArithmeticOp::Subtract},
+                {"*=", ArithmeticOp::Multiply}, {"/=", ArithmeticOp::Divide},
+                {"%=", ArithmeticOp::Modulo}, {"&=", ArithmeticOp::BitAnd},
+                {"^=", ArithmeticOp::BitXor}, {"|=", ArithmeticOp::BitOr}
+            };
+
+            ArithmeticOp::Operator op = ArithmeticOp::None;
+            bool found = false;
+            for (const auto &assignment : assignments) {
+                if (accept(assignment.token)) {
+                    op = assignment.op;
+                    found = true;
+                    break;
+                }
+            }
+            if (!found && !accept_not_followed("=", "=")) {
+                return lhs;
+            }
+
+            if (expr.ops[lhs].kind != ArithmeticOp::Variable) {
+                return error("attempted assignment to non-variable");
+            }
+
+            // Assignment is right associative
+            ArithmeticOp node{ArithmeticOp::Assign};
+            node.op = op;
+            node.name = expr.ops[lhs].name;
+            node.rhs = parse_assignment();
+            return add(node);
+        }
+
+        int parse_ternary() {
+            int condition = parse_logical_or();
+            if (failed || !accept("?")) {
+                return condition;
+            }
+
+            ArithmeticOp node{ArithmeticOp::Ternary};
+            node.lhs = condition;
+            node.rhs = parse_comma();
+            if (!accept(":")) {
+                return error("expected ':' in conditional expression");
+            }
+            node.third = parse_assignment();
+            return add(node);
+        }
+
+        int parse_logical_or() {
+            int lhs = parse_logical_and();
+            while (!failed && accept("||")) {
+                lhs = add_binary(ArithmeticOp::LogicalOr, lhs, parse_logical_and());
+            }
+            return lhs;
+        }
+
+        int parse_logical_and() {
+            int lhs = parse_bit_or();
+            while (!failed && accept("&&")) {
+                lhs = add_binary(ArithmeticOp::LogicalAnd, lhs, parse_bit_or());
+            }
+            return lhs;
+        }
+
+        int parse_bit_or() {
+            int lhs = parse_bit_xor();
+            while (!failed && accept_not_followed("|", "|=")) {
+                lhs = add_binary(ArithmeticOp::BitOr, lhs, parse_bit_xor());
+            }
+            return lhs;
+        }
+
+        int parse_bit_xor() {
+            int lhs = parse_bit_and();
+            while (!failed && accept_not_followed("^", "=")) {
+                lhs = add_binary(ArithmeticOp::BitXor, lhs, parse_bit_and());
+            }
+            return lhs;
+        }
+
+        int parse_bit_and() {
+            int lhs = parse_equality();
+            while (!failed && accept_not_followed("&", "&=")) {
+                lhs = add_binary(ArithmeticOp::BitAnd, lhs, parse_equality());
+            }
+            return lhs;
+        }
+
+        int parse_equality() {
+            int lhs = parse_relational();
+            while (!failed) {
+                if (accept("==")) {
+                    lhs = add_binary(ArithmeticOp::Equal, lhs, parse_relational());
+                } else if (accept("!=")) {
+                    lhs = add_binary(ArithmeticOp::NotEqual, lhs, parse_relational());
+                } else {
+                    break;
+                }
+            }
+            return lhs;
+        }
+
+        int parse_relational() {
+            int lhs = parse_shift();
+            while (!failed) {
+                if (accept("<=")) {
+                    lhs = add_binary(ArithmeticOp::LessEqual, lhs, parse_shift());
+                } else if (accept(">=")) {
+                    lhs = add_binary(ArithmeticOp::GreaterEqual, lhs, parse_shift());
+                } else if (accept_not_followed("<", "<")) {
+                    lhs = add_binary(ArithmeticOp::Less, lhs, parse_shift());
+                } else if (accept_not_followed(">", ">")) {
+                    lhs = add_binary(ArithmeticOp::Greater, lhs, parse_shift());
+                } else {
+                    break;
+                }
+            }
+            return lhs;
+        }
+
+        int parse_shift() {
+            int lhs = parse_additive();
+            while (!failed) {
+                if (accept_not_followed("<<", "=")) {
+                    lhs = add_binary(ArithmeticOp::ShiftLeft, lhs, parse_additive());
+                } else if (accept_not_followed(">>", "=")) {
+                    lhs = add_binary(ArithmeticOp::ShiftRight, lhs, parse_additive());
+                } else {
+                    break;
+                }
+            }
+            return lhs;
+        }
+
+        int parse_additive() {
+            int lhs = parse_multiplicative();
+            while (!failed) {
+                if (accept_not_followed("+", "+=")) {
+                    lhs = add_binary(ArithmeticOp::Add, lhs, parse_multiplicative());
+                } else if (accept_not_followed("-", "-=")) {
+                    lhs = add_binary(ArithmeticOp::Subtract, lhs, parse_multiplicative());
+                } else {
+                    break;
+                }
+            }
+            return lhs;
+        }
+
+        int parse_multiplicative() {
+            int lhs = parse_power();
+            while (!failed) {
+                if (accept_not_followed("*", "*=")) {
+                    lhs = add_binary(ArithmeticOp::Multiply, lhs, parse_power());
+                } else if (accept_not_followed("/", "=")) {
+                    lhs = add_binary(ArithmeticOp::Divide, lhs, parse_power());
+                } else if (accept_not_followed("%", "=")) {
+                    lhs = add_binary(ArithmeticOp::Modulo, lhs, parse_power());
+                } else {
+                    break;
+                }
+            }
+            return lhs;
+        }
+
+        int parse_power() {
+            int lhs = parse_unary();
+            if (!failed && accept("**")) {
+                // Exponentiation is right associative
+                return add_binary(ArithmeticOp::Power, lhs, parse_power());
+            }
+            return lhs;
+        }
+
+        int parse_unary() {
+            if (accept("++") || accept("--")) {
+                long long step = source[pos - 1] == '+' ? 1 : -1;
+                int operand = parse_unary();
+                if (failed) {
+                    return -1;
+                }
+                if (expr.ops[operand].kind != ArithmeticOp::Variable) {
+                    return error("increment or decrement of non-variable");
+                }
+                ArithmeticOp node{ArithmeticOp::PreStep};
+                node.name = expr.ops[operand].name;
+                node.value = step;
+                return add(node);
+            }
+
+            ArithmeticOp::Operator op = ArithmeticOp::None;
+            if (accept("-")) {
+                op = ArithmeticOp::Negate;
+            } else if (accept("+")) {
+                op = ArithmeticOp::Plus;
+            } else if (accept_not_followed("!", "=")) {
+                op = ArithmeticOp::LogicalNot;
+            } else if (accept("~")) {
+                op = ArithmeticOp::BitNot;
+            }
+
+            if (op != ArithmeticOp::None) {
+                ArithmeticOp node{ArithmeticOp::Unary};
+                node.op = op;
+                node.lhs = parse_unary();
+                return add(node);
+            }
+
+            return parse_postfix();
+        }
+
+        int parse_postfix() {
+            int operand = parse_primary();
+            if (failed || expr.ops[operand].kind != ArithmeticOp::Variable) {
+                return operand;
+            }
+
+            if (accept("++") || accept("--")) {
+                ArithmeticOp node{ArithmeticOp::PostStep};
+                node.name = expr.ops[operand].name;
+                node.value = source[pos - 1] == '+' ? 1 : -1;
+                return add(node);
+            }
+            return operand;
+        }
+
+        int parse_primary() {
+            skip_whitespace();
+
+            if (accept("(")) {
+                int inner = parse_comma();
+                if (!failed && !accept(")")) {
+                    return error("expected ')'");
+                }
+                return inner;
+            }
+
+            if (pos < source.size() && isdigit(static_cast<unsigned char>(source[pos]))) {
+                // Base 0 handles decimal, 0x hexadecimal and 0 octal like C
+                const char *start = source.c_str() + pos;
+                char *end;
+                ArithmeticOp node{ArithmeticOp::Number};
+                node.value = strtoll(start, &end, 0);
+                pos += end - start;
+                if (pos < source.size() && isalnum(static_cast<unsigned char>(source[pos]))) {
+                    return error("invalid number");
+                }
+                return add(node);
+            }
+
+            // Allow $name and ${name} inside arithmetic as well as a bare name
+            bool braced = false;
+            if (pos < source.size() && source[pos] == '$') {
+                pos++;
+                if (pos < source.size() && source[pos] == '{') {
+                    braced = true;
+                    pos++;
+                }
+            }
+
+            size_t name_start = pos;
+            if (pos < source.size() && (isalpha(static_cast<unsigned char>(source[pos])) || source[pos] == '_')) {
+                while (pos < source.size() && (isalnum(static_cast<unsigned char>(source[pos])) || source[pos] == '_')) {
+                    pos++;
+                }
+                ArithmeticOp node{ArithmeticOp::Variable};
+                node.name = intern_name(source.substr(name_start, pos - name_start));
+
+                if (braced) {
+                    if (pos >= source.size() || source[pos] != '}') {
+                        return error("bad substitution");
+                    }
+                    pos++;
+                }
+                return add(node);
+            }
+
+            if (braced) {
+                return error("bad substitution");
+            }
+
+            if (pos >= source.size()) {
+                return error("operand expected");
+            }
+            return error(std::string("syntax error near '") + source[pos] + "'");
+        }
+
+    public:
+        ArithmeticParser(const std::string &source, ArithmeticExpression &expr) : source(source), expr(expr) {}
+
+        bool parse() {
+            skip_whitespace();
+            if (pos == source.size()) {
+                // An empty expression evaluates to 0
+                ArithmeticOp node{ArithmeticOp::Number};
+                expr.root = add(node);
+                return true;
+            }
+
+            expr.root = parse_comma();
+            skip_whitespace();
+            if (!failed && pos != source.size()) {
+                error(std::string("syntax error near '") + source[pos] + "'");
+            }
+            return !failed;
+        }
+};
+
+static long long variable_value(const std::string &name) {
+    const std::string *value = get_variable(name);
+    if (value == nullptr || value->empty()) {
+        return 0;
+    }
+    return strtoll(value->c_str(), nullptr, 10);
+}
+
+static bool apply_binary(ArithmeticOp::Operator op, long long lhs, long long rhs, long long &result) {
+    switch (op) {
+        case ArithmeticOp::Comma: result = rhs; break;
+        case ArithmeticOp::BitOr: result = lhs | rhs; break;
+        case ArithmeticOp::BitXor: result = lhs ^ rhs; break;
+        case ArithmeticOp::BitAnd: result = lhs & rhs; break;
+        case ArithmeticOp::Equal: result = lhs == rhs; break;
+        case ArithmeticOp::NotEqual: result = lhs != rhs; break;
+        case ArithmeticOp::Less: result = lhs < rhs; break;
+        case ArithmeticOp::LessEqual: result = lhs <= rhs; break;
+        case ArithmeticOp::Greater: result = lhs > rhs; break;
+        case ArithmeticOp::GreaterEqual: result = lhs >= rhs; break;
+        case ArithmeticOp::ShiftLeft: result = static_cast<long long>(static_cast<unsigned long long>(lhs) << (rhs & 63)); break;
+        case ArithmeticOp::ShiftRight: result = lhs >> (rhs & 63); break;
+        // Wrap on overflow like bash instead of invoking undefined behaviour
+        case ArithmeticOp::Add: result = static_cast<long long>(static_cast<unsigned long long>(lhs) + rhs); break;
+        case ArithmeticOp::Subtract: result = static_cast<long long>(static_cast<unsigned long long>(lhs) - rhs); break;
+        case ArithmeticOp::Multiply: result = static_cast<long long>(static_cast<unsigned long long>(lhs) * rhs); break;
+        case ArithmeticOp::Divide:
+        case ArithmeticOp::Modulo:
+            if (rhs == 0) {
+                std::cerr << "kash: division by 0" << std::endl;
+                return false;
+            }
+            if (rhs == -1) {
+                // Avoid trapping on LLONG_MIN / -1
+                result = op == ArithmeticOp::Divide ? static_cast<long long>(0ULL - lhs) : 0;
+            } else {
+                result = op == ArithmeticOp::Divide ? lhs / rhs : lhs % rhs;
+            }
+            break;
+        case ArithmeticOp::Power:
+            if (rhs < 0) {
+                std::cerr << "kash: exponent less than 0" << std::endl;
+                return false;
+            }
+            result = 1;
+            for (unsigned long long base = lhs; rhs > 0; rhs >>= 1) {
+                if (rhs & 1) {
+                    result = static_cast<long long>(static_cast<unsigned long long>(result) * base);
+                }
+                base *= base;
+            }
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+bool ArithmeticExpression::evaluate(int index, long long &result) const {
+    const ArithmeticOp &node = ops[index];
+
+    switch (node.kind) {
+        case ArithmeticOp::Number:
+            result = node.value;
+            return true;
+
+        case ArithmeticOp::Variable:
+            result = variable_value(names[node.name]);
+            return true;
+
+        case ArithmeticOp::Unary: {
+            long long operand;
+            if (!evaluate(node.lhs, operand)) {
+                return false;
+            }
+            switch (node.op) {
+                case ArithmeticOp::Negate: result = static_cast<long long>(0ULL - operand); break;
+                case ArithmeticOp::Plus: result = operand; break;
+                case ArithmeticOp::LogicalNot: result = !operand; break;
+                case ArithmeticOp::BitNot: result = ~operand; break;
+                default: return false;
+            }
+            return true;
+        }
+
+        case ArithmeticOp::Binary: {
+            long long lhs, rhs;
+            if (!evaluate(node.lhs, lhs)) {
+                return false;
+            }
+
+            // && and || short circuit, so the right side may have no side effects
+            if (node.op == ArithmeticOp::LogicalAnd || node.op == ArithmeticOp::LogicalOr) {
+                if ((node.op == ArithmeticOp::LogicalAnd) != (lhs != 0)) {
+                    result = lhs != 0;
+                    return true;
+                }
+                if (!evaluate(node.rhs, rhs)) {
+                    return false;
+                }
+                result = rhs != 0;
+                return true;
+            }
+
+            if (!evaluate(node.rhs, rhs)) {
+                return false;
+            }
+            return apply_binary(node.op, lhs, rhs, result);
+        }
+
+        case ArithmeticOp::Ternary: {
+            long long condition;
+            if (!evaluate(node.lhs, condition)) {
+                return false;
+            }
+            return evaluate(condition ? node.rhs : node.third, result);
+        }
+
+        case ArithmeticOp::Assign: {
+            long long rhs;
+            if (!evaluate(node.rhs, rhs)) {
+                return false;
+            }
+            const std::string &name = names[node.name];
+            if (node.op == ArithmeticOp::None) {
+                result = rhs;
+            } else if (!apply_binary(node.op, variable_value(name), rhs, result)) {
+                return false;
+            }
+            set_variable(name, std::to_string(result));
+            return true;
+        }
+
+        case ArithmeticOp::PreStep:
+        case ArithmeticOp::PostStep: {
+            const std::string &name = names[node.name];
+            long long old_value = variable_value(name);
+            long long new_value = static_cast<long long>(static_cast<unsigned long long>(old_value) + node.value);
+            set_variable(name, std::to_string(new_value));
+            result = node.kind == ArithmeticOp::PreStep ? new_value : old_value;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+std::unique_ptr<ArithmeticExpression> parse_arithmetic(const std::string &source) {
+    auto expr = std::make_unique<ArithmeticExpression>();
+    ArithmeticParser parser(source, *expr);
+    if (!parser.parse()) {
+        return nullptr;
+    }
+    return expr;
+}
+
+const ArithmeticExpression *compile_arithmetic(const std::string &source) {
+    // Every distinct expression written in the input, keyed by its source text.
+    // Text built at runtime never gets here, so this only grows with the script.
+    static std::unordered_map<std::string, std::unique_ptr<ArithmeticExpression>> cache;
+
+    auto it = cache.find(source);
+    if (it != cache.end()) {
+        return it->second.get();
+    }
+
+    std::unique_ptr<ArithmeticExpression> expr = parse_arithmetic(source);
+    if (!expr) {
+        return nullptr;
+    }
+
+    return cache.emplace(source, std::move(expr)).first->second.get();
+}
+
+bool evaluate_arithmetic(const std::string &source, long long &result) {
+    std::unique_ptr<ArithmeticExpression> expr = parse_arithmetic(source);
+    if (!expr) {
+        return false;
+    }
+    return expr->evaluate(result);
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+
+// Integer arithmetic used by $(( )), (( )) and let.
+//
+// Expressions are compiled into a flat tree of nodes that refer to their
+// children by index, and evaluated directly against the shell variables.
+// Expressions written directly in the input are cached by their source text,
+// so one that is evaluated repeatedly is only ever parsed once. Text that was
+// built by expansion (like the arguments of let i=$i+1) is compiled and
+// thrown away, so it can't grow the cache without bound.
+
+struct ArithmeticOp {
+    enum Kind : unsigned char {
+        Number,     // value
+        Variable,   // name
+        Unary,      // op lhs
+        Binary,     // lhs op rhs
+        Ternary,    // lhs ? rhs : third
+        Assign,     // name op= rhs (op is None for plain =)
+        PreStep,    // ++name / --name (value is the step)
+        PostStep    // name++ / name-- (value is the step)
+    };
+
+    enum Operator : unsigned char {
+        None,
+        Comma, LogicalOr, LogicalAnd, BitOr, BitXor, BitAnd,
+        Equal, NotEqual, Less, LessEqual, Greater, GreaterEqual,
+        ShiftLeft, ShiftRight, Add, Subtract, Multiply, Divide, Modulo, Power,
+        Negate, Plus, LogicalNot, BitNot
+    };
+
+    Kind kind;
+    Operator op = None;
+    int lhs = -1;
+    int rhs = -1;
+    int third = -1;
+    int name = -1;      // index into ArithmeticExpression::names
+    long long value = 0;
+};
+
+class ArithmeticExpression {
+    private:
+        std::vector<ArithmeticOp> ops;
+        std::vector<std::string> names;
+        int root = -1;
+
+        bool evaluate(int index, long long &result) const;
+        friend class ArithmeticParser;
+    public:
+        // Evaluate the expression, returning false on a runtime error such as division by zero
+        bool evaluate(long long &result) const { return evaluate(root, result); }
+};
+
+// Compile an expression without caching it.
+// Returns nullptr (after printing a message) if the expression has a syntax error.
+std::unique_ptr<ArithmeticExpression> parse_arithmetic(const std::string &source);
+
+// Compile an expression that appears literally in the input, or return the
+// cached compilation of an identical one
+const ArithmeticExpression *compile_arithmetic(const std::string &source);
+
+// Compile, evaluate and discard an expression built at runtime
+bool evaluate_arithmetic(const std::string &source, long long &result);
@@ -0,0 +1,65 @@
+#include "functions.hpp"
+#include "variables.hpp"
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+struct Function {
+    std::shared_ptr<Node> body;
+    std::string source;
+};
+
+static std::unordered_map<std::string, Function> functions;
+static bool returning = false;
+static int return_status = EXIT_SUCCESS;
+
+void define_function(const std::string &name, std::shared_ptr<Node> body, const std::string &source) {
+    functions[name] = {std::move(body), source};
+}
+
+std::shared_ptr<Node> find_function(const std::string &name) {
+    auto it = functions.find(name);
+    if (it == functions.end()) {
+        return nullptr;
+    }
+    return it->second.body;
+}
+
+const std::string *find_function_source(const std::string &name) {
+    auto it = functions.find(name);
+    if (it == functions.end()) {
+        return nullptr;
+    }
+    return &it->second.source;
+}
+
+int call_function(const std::shared_ptr<Node> &body, std::vector<std::string> &args) {
+    // Hold a reference so the body outlives a redefinition from inside itself
+    std::shared_ptr<Node> running = body;
+
+    // args becomes the new positional parameters, and gets the caller's back afterwards
+    std::vector<std::string> &positional = positional_parameters();
+    positional.swap(args);
+    push_variable_scope();
+
+    int status = running->execute();
+    if (returning) {
+        status = return_status;
+        returning = false;
+    }
+
+    pop_variable_scope();
+    positional.swap(args);
+
+    return status;
+}
+
+void request_return(int status) {
+    returning = true;
+    return_status = status;
+}
+
+bool return_pending() {
+    return returning;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include "AST.hpp"
+#include <string>
+#include <vector>
+#include <memory>
+
+// Shell functions defined with name() { ... }
+//
+// Function bodies are kept as parsed ASTs and run in the shell process itself,
+// so calling a function never forks (unless it's part of a pipeline or subshell,
+// which fork on their own).
+
+void define_function(const std::string &name, std::shared_ptr<Node> body, const std::string &source);
+
+// Returns the body of a function, or nullptr if no function has that name.
+// The body is shared so that redefining a function while it runs is safe.
+std::shared_ptr<Node> find_function(const std::string &name);
+
+// Returns the source text of a function's body, or nullptr if no function has that name
+const std::string *find_function_source(const std::string &name);
+
+// Run a function with args[0] as its name and the rest as positional parameters
+int call_function(const std::shared_ptr<Node> &body, std::vector<std::string> &args);
+
+// return builtin support. While a return is pending, sequences and
+// && / || lists stop executing so control unwinds back to call_function.
+void request_return(int status);
+bool return_pending();
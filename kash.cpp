@@ -51,7 +51,15 @@ std::string get_prompt_path() {
     return "";
 }
 
-int main(void) {
+int main(int argc, char *argv[]) {
+    // kash -c 'command' runs a single command string and exits
+    if (argc >= 3 && strcmp(argv[1], "-c") == 0) {
+        std::unique_ptr<Node> root = parse_command(argv[2]);
+
+        // The shell exits right after, so the final command can replace it
+        return root->executeLast();
+    }
+
     char* input;
     std::string prompt = "kash: " + get_prompt_path() + " > ";
 
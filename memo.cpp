@@ -0,0 +1,441 @@
+#include "memo.hpp"
+#include "AST.hpp"
+#include "variables.hpp"
+#include "functions.hpp"
+#include "transfer.hpp"
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/wait.h>
+#include <signal.h>
+
+#ifdef __APPLE__
+#define st_mtim st_mtimespec
+#endif
+
+// Every entry starts with a fixed width "<status> <key length>\n" header so it
+// can be written before the status is known and filled in afterwards
+static const int header_size = 33;
+static const long long default_cache_size = 64LL * 1024 * 1024;
+
+static std::string cache_directory() {
+    const std::string *dir = get_variable("KASH_MEMO_DIR");
+    if (dir != nullptr && !dir->empty()) {
+        return *dir;
+    }
+
+    const std::string *home = get_variable("HOME");
+    return (home != nullptr ? *home : std::string("/tmp")) + "/.cache/kash/memo";
+}
+
+static bool make_directories(const std::string &path) {
+    for (size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1)) {
+        std::string prefix = path.substr(0, slash);
+        if (mkdir(prefix.c_str(), 0755) == -1 && errno != EEXIST) {
+            perror(("memo: " + prefix).c_str());
+            return false;
+        }
+        if (slash == std::string::npos) {
+            return true;
+        }
+    }
+}
+
+// 64-bit FNV-1a. Collisions are harmless because entries store the full key.
+static unsigned long long hash_key(const std::string &key) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (unsigned char c : key) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void append_stat(std::string &key, const struct stat &st) {
+    key += " " + std::to_string(st.st_ino) + " " + std::to_string(st.st_size) + " " +
+           std::to_string(st.st_mtim.tv_sec) + "." + std::to_string(st.st_mtim.tv_nsec);
+}
+
+static void append_file_fingerprint(std::string &key, const std::string &path) {
+    struct stat st;
+    key += path;
+    if (stat(path.c_str(), &st) == -1) {
+        key += " missing\n";
+        return;
+    }
+
+    append_stat(key, st);
+    key += "\n";
+}
+
+// Add whatever the command could read from stdin to the key. Returns false when
+// stdin is a stream (a pipe, socket, ...) whose contents can't be fingerprinted.
+static bool append_stdin_fingerprint(std::string &key) {
+    struct stat st;
+    if (isatty(STDIN_FILENO) || fstat(STDIN_FILENO, &st) == -1) {
+        return true;
+    }
+
+    struct stat null_stat;
+    if (S_ISCHR(st.st_mode) && stat("/dev/null", &null_stat) == 0 && st.st_rdev == null_stat.st_rdev) {
+        return true;
+    }
+
+    if (!S_ISREG(st.st_mode)) {
+        return false;
+    }
+
+    // A redirected file, fingerprinted like -i files plus where reading starts
+    key += "stdin";
+    append_stat(key, st);
+    key += " " + std::to_string(lseek(STDIN_FILENO, 0, SEEK_CUR)) + "\n";
+    return true;
+}
+
+// Find the file execvp would run for command, or return it unchanged
+static std::string resolve_command(const std::string &command) {
+    if (command.find('/') != std::string::npos) {
+        return command;
+    }
+
+    const std::string *path = get_variable("PATH");
+    if (path == nullptr) {
+        return command;
+    }
+
+    size_t start = 0;
+    while (start <= path->size()) {
+        size_t end = path->find(':', start);
+        if (end == std::string::npos) {
+            end = path->size();
+        }
+
+        std::string dir = path->substr(start, end - start);
+        std::string candidate = (dir.empty() ? "." : dir) + "/" + command;
+        if (access(candidate.c_str(), X_OK) == 0) {
+            return candidate;
+        }
+        start = end + 1;
+    }
+
+    return command;
+}
+
+// Read "hits misses" from an open stats file, treating anything unreadable as zero
+static void read_stats(int fd, long long &hits, long long &misses) {
+    char buffer[64];
+    ssize_t length = pread(fd, buffer, sizeof(buffer) - 1, 0);
+    buffer[length > 0 ? length : 0] = '\0';
+    if (sscanf(buffer, "%lld %lld", &hits, &misses) != 2) {
+        hits = misses = 0;
+    }
+}
+
+// Hit and miss counts are kept in the cache directory so they cover every shell
+// using it. The file stays locked while it's updated so concurrent lookups from
+// other shells aren't lost.
+static void record_lookup(const std::string &dir, bool hit) {
+    int fd = open((dir + "/stats").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return;
+    }
+    if (flock(fd, LOCK_EX) == -1) {
+        close(fd);
+        return;
+    }
+
+    long long hits = 0, misses = 0;
+    read_stats(fd, hits, misses);
+    (hit ? hits : misses)++;
+
+    std::string line = std::to_string(hits) + " " + std::to_string(misses) + "\n";
+    if (ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0) {
+        write_all(fd, line.data(), line.size());
+    }
+    close(fd); // Releases the lock
+}
+
+static int print_stats(const std::string &dir) {
+    long long hits = 0, misses = 0;
+    int fd = open((dir + "/stats").c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd != -1) {
+        if (flock(fd, LOCK_SH) == 0) {
+            read_stats(fd, hits, misses);
+        }
+        close(fd);
+    }
+
+    long long total = hits + misses;
+    std::cout << "memo: " << hits << " hits, " << misses << " misses";
+    if (total > 0) {
+        std::cout << " (" << (hits * 100 / total) << "% hit rate)";
+    }
+    std::cout << std::endl;
+    return EXIT_SUCCESS;
+}
+
+// Replay a cached entry. Returns false if there is no usable entry for key.
+static bool replay(const std::string &path, const std::string &key, int &status) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size < header_size) {
+        close(fd);
+        return false;
+    }
+
+    void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+
+    const char *data = static_cast<const char *>(mapping);
+    size_t key_length = 0;
+    bool valid = sscanf(data, "%d %zu", &status, &key_length) == 2 &&
+                 header_size + key_length <= static_cast<size_t>(st.st_size) &&
+                 key.compare(0, std::string::npos, data + header_size, key_length) == 0;
+
+    if (valid) {
+        std::cout.flush();
+        size_t offset = header_size + key_length;
+        write_all(STDOUT_FILENO, data + offset, st.st_size - offset);
+
+        // The mtime doubles as the last use time for eviction
+        utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+    }
+
+    munmap(mapping, st.st_size);
+    return valid;
+}
+
+// Delete the least recently used entries until the cache fits in its size limit
+static void evict(const std::string &dir) {
+    long long limit = default_cache_size;
+    const std::string *size = get_variable("KASH_MEMO_SIZE");
+    if (size != nullptr && !size->empty()) {
+        char *end;
+        errno = 0;
+        long long requested = strtoll(size->c_str(), &end, 10);
+        if (errno != 0 || *end != '\0' || requested <= 0) {
+            std::cerr << "kash: KASH_MEMO_SIZE: '" << *size << "' is not a positive number of bytes" << std::endl;
+        } else {
+            limit = requested;
+        }
+    }
+
+    DIR *directory = opendir(dir.c_str());
+    if (directory == nullptr) {
+        return;
+    }
+
+    struct Entry {
+        std::string path;
+        long long size;
+        struct timespec used;
+    };
+    std::vector<Entry> entries;
+    long long total = 0;
+
+    while (struct dirent *dirent = readdir(directory)) {
+        std::string name = dirent->d_name;
+        if (name.size() < 6 || name.compare(name.size() - 5, 5, ".memo") != 0) {
+            continue;
+        }
+
+        struct stat st;
+        std::string path = dir + "/" + name;
+        if (stat(path.c_str(), &st) == 0) {
+            entries.push_back({path, static_cast<long long>(st.st_size), st.st_mtim});
+            total += st.st_size;
+        }
+    }
+    closedir(directory);
+
+    if (total <= limit) {
+        return;
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        return a.used.tv_sec != b.used.tv_sec ? a.used.tv_sec < b.used.tv_sec : a.used.tv_nsec < b.used.tv_nsec;
+    });
+
+    for (const auto &entry : entries) {
+        if (total <= limit) {
+            break;
+        }
+        if (unlink(entry.path.c_str()) == 0) {
+            total -= entry.size;
+        }
+    }
+}
+
+// Run the command with its stdout going both to ours and into a new cache entry
+static int run_and_store(const std::string &path, const std::string &key, std::vector<std::string> &command) {
+    std::string temp_path = path + "." + std::to_string(getpid()) + ".tmp";
+    int temp_fd = open(temp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (temp_fd != -1) {
+        std::string header(header_size, ' ');
+        header.back() = '\n';
+        if (!write_all(temp_fd, header.data(), header.size()) || !write_all(temp_fd, key.data(), key.size())) {
+            close(temp_fd);
+            unlink(temp_path.c_str());
+            temp_fd = -1;
+        }
+    }
+
+    if (temp_fd == -1) {
+        // The cache isn't usable, just run the command
+        return CommandNode::run(command, false);
+    }
+
+    int pipefd[2];
+    if (pipe(pipefd) == -1) {
+        perror("pipe failed");
+        close(temp_fd);
+        unlink(temp_path.c_str());
+        return EXIT_FAILURE;
+    }
+
+    std::cout.flush();
+    pid_t pid = fork();
+
+    if (pid == -1) {
+        perror("fork failed");
+        close(pipefd[0]);
+        close(pipefd[1]);
+        close(temp_fd);
+        unlink(temp_path.c_str());
+        return EXIT_FAILURE;
+    } else if (pid == 0) {
+        // Child process
+        signal(SIGINT, SIG_DFL);
+        close(pipefd[0]);
+        dup2(pipefd[1], STDOUT_FILENO);
+        close(pipefd[1]);
+
+        int status = CommandNode::run(command, true);
+        exit(status);
+    }
+
+    // Only parent process should reach this code
+    close(pipefd[1]);
+    TransferResult result = tee_fd(pipefd[0], STDOUT_FILENO, {temp_fd});
+    close(pipefd[0]);
+
+    int wait_status = wait_for_child(pid, 0);
+    int status = exit_status(wait_status);
+
+    // Commands killed by a signal (or whose output couldn't be saved) aren't cached
+    char header[header_size + 1];
+    snprintf(header, sizeof(header), "%11d %20zu", status, key.size());
+    header[header_size - 1] = '\n';
+
+    bool stored = !result.failed && WIFEXITED(wait_status) &&
+                  pwrite(temp_fd, header, header_size, 0) == header_size;
+    close(temp_fd);
+
+    if (stored && rename(temp_path.c_str(), path.c_str()) == 0) {
+        evict(path.substr(0, path.rfind('/')));
+    } else {
+        unlink(temp_path.c_str());
+    }
+
+    return status;
+}
+
+int memo_command(const std::vector<std::string> &args) {
+    std::string dir = cache_directory();
+    std::vector<std::string> env_vars;
+    std::vector<std::string> input_files;
+
+    size_t i = 1;
+    for (; i < args.size(); i++) {
+        if (args[i] == "--stats") {
+            return print_stats(dir);
+        } else if ((args[i] == "-e" || args[i] == "-i") && i + 1 < args.size()) {
+            (args[i] == "-e" ? env_vars : input_files).push_back(args[i + 1]);
+            i++;
+        } else if (args[i] == "--") {
+            i++;
+            break;
+        } else {
+            break;
+        }
+    }
+
+    if (i >= args.size()) {
+        std::cerr << "memo: usage: memo [-e VAR]... [-i FILE]... [--] command args..." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<std::string> command(args.begin() + i, args.end());
+
+    char cwd[1024];
+    std::string key = "cwd ";
+    key += getcwd(cwd, sizeof(cwd)) != nullptr ? cwd : "";
+    const std::string *function_source = find_function_source(command[0]);
+    if (function_source != nullptr) {
+        // Redefining the function has to miss, so its body is part of the key
+        key += "\nfunction " + command[0] + " " + std::to_string(function_source->size()) + " " + *function_source + "\n";
+    } else {
+        key += "\ncommand ";
+        append_file_fingerprint(key, resolve_command(command[0]));
+    }
+    for (const auto &arg : command) {
+        key += "arg " + std::to_string(arg.size()) + " " + arg + "\n";
+    }
+    for (const auto &name : env_vars) {
+        const std::string *value = get_variable(name);
+        key += "env " + name + (value != nullptr ? "=" + *value : std::string(" unset")) + "\n";
+    }
+    for (const auto &file : input_files) {
+        key += "input ";
+        append_file_fingerprint(key, file);
+    }
+
+    bool tracing = tracing_enabled();
+    if (!append_stdin_fingerprint(key)) {
+        // Different input could produce different output, so there's nothing safe to replay
+        if (tracing) {
+            std::cerr << "kash: memo: stdin is not a file, not caching" << std::endl;
+        }
+        return CommandNode::run(command, false);
+    }
+
+    if (!make_directories(dir)) {
+        return CommandNode::run(command, false);
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.memo", hash_key(key));
+    std::string path = dir + "/" + name;
+
+    int status;
+    if (replay(path, key, status)) {
+        record_lookup(dir, true);
+        if (tracing) {
+            std::cerr << "kash: memo: hit " << name << std::endl;
+        }
+        return status;
+    }
+
+    record_lookup(dir, false);
+    if (tracing) {
+        std::cerr << "kash: memo: miss " << name << std::endl;
+    }
+    return run_and_store(path, key, command);
+}
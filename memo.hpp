@@ -0,0 +1,22 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// memo builtin: cache a command's output and exit status.
+//
+//   memo [-e VAR]... [-i FILE]... [--] command args...
+//   memo --stats
+//
+// The cache key covers the working directory, the resolved command (its
+// binary's inode, size and mtime, or a function's body), the arguments, the
+// values of each -e variable, and the inode, size and mtime of each -i input
+// file. Entries live in $KASH_MEMO_DIR (default ~/.cache/kash/memo), are
+// replayed with mmap, and the least recently used ones are evicted once the
+// directory grows past $KASH_MEMO_SIZE bytes (default 64 MiB). Only stdout
+// is cached, stderr passes through on a miss.
+//
+// stdin counts as an input too. A terminal or /dev/null adds nothing to the
+// key, a redirected regular file adds its inode, size, mtime and read offset,
+// and anything else (a pipe, for example) can't be fingerprinted, so the
+// command just runs without caching.
+int memo_command(const std::vector<std::string> &args);
@@ -1,5 +1,6 @@
 #include "AST.hpp"
 #include "parse_commands.hpp"
+#include "variables.hpp"
 #include <sstream>
 #include <string>
 #include <memory>
@@ -10,7 +11,13 @@ bool is_builtin_command(const std::string &command) {
     static const std::vector<std::string> builtin_commands = {
             "cd",
             "pwd",
-            "exit"
+            "exit",
+            "let",
+            "local",
+            "return",
+            "cat",
+            "tee",
+            "memo"
     };
 
     for (const auto &builtin_command : builtin_commands) {
@@ -22,20 +29,150 @@ bool is_builtin_command(const std::string &command) {
     return false;
 }
 
+// Returns the number of unclosed parentheses in an arithmetic token
+// like "((" or "$((i", or 0 if the token doesn't start arithmetic
+static int arithmetic_depth(const std::string &token) {
+    if (token.find("((") == std::string::npos) {
+        return 0;
+    }
+
+    int depth = 0;
+    for (char c : token) {
+        if (c == '(') {
+            depth++;
+        } else if (c == ')') {
+            depth--;
+        }
+    }
+    return depth;
+}
+
+// Build the node for a single simple command
+static std::unique_ptr<Node> make_command_node(const std::vector<std::string> &args) {
+    if (args.empty()) {
+        return std::make_unique<CommandNode>(args);
+    }
+
+    // (( expression ))
+    const std::string &first = args[0];
+    if (args.size() == 1 && first.size() >= 4 && first.compare(0, 2, "((") == 0 && first.compare(first.size() - 2, 2, "))") == 0) {
+        return std::make_unique<ArithmeticNode>(first.substr(2, first.size() - 4));
+    }
+
+    // name=value
+    size_t equals = first.find('=');
+    if (args.size() == 1 && equals != std::string::npos && is_valid_variable_name(first.substr(0, equals))) {
+        return std::make_unique<AssignmentNode>(first.substr(0, equals), first.substr(equals + 1));
+    }
+
+    if (is_builtin_command(first)) {
+        return std::make_unique<BuiltinCommandNode>(args);
+    }
+    return std::make_unique<CommandNode>(args);
+}
+
+// Returns the RedirectionNode type for a redirection operator, or -1 if token isn't one
+static int redirect_type(const std::string &token) {
+    static const char *operators[] = {"<", ">", ">>", "2>", "2>>", "&>", "&>>"};
+
+    for (int i = 0; i < 7; i++) {
+        if (token == operators[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Build the node for a command, wrapped in any redirections that followed it
+static std::unique_ptr<Node> finish_command(std::unique_ptr<Node> compound_node, const std::vector<std::string> &args,
+                                            const std::vector<std::pair<int, std::string>> &redirections) {
+    std::unique_ptr<Node> node = compound_node ? std::move(compound_node) : make_command_node(args);
+
+    // The outermost node is applied first, so wrap in reverse to apply them left to right
+    for (auto it = redirections.rbegin(); it != redirections.rend(); ++it) {
+        node = std::make_unique<RedirectionNode>(std::move(node), it->second, it->first);
+    }
+    return node;
+}
+
+// Parse the "{ ... }" of a function definition once its name() has been read
+static std::unique_ptr<Node> parse_function_definition(const std::string &name, std::istringstream &iss) {
+    std::string token;
+    if (!is_valid_variable_name(name) || !(iss >> token) || token != "{") {
+        std::cerr << "kash: syntax error in definition of function " << name << std::endl;
+        return nullptr;
+    }
+
+    // Collect the body up to the matching }
+    std::string body;
+    int depth = 1;
+    while (iss >> token) {
+        if (token == "{") {
+            depth++;
+        } else if (token == "}" && --depth == 0) {
+            break;
+        }
+        body += token + " ";
+    }
+
+    if (depth != 0) {
+        std::cerr << "kash: syntax error: missing '}' in function " << name << std::endl;
+        return nullptr;
+    }
+
+    return std::make_unique<FunctionDefinitionNode>(name, parse_command(body), body);
+}
+
+// Parse a "( ... )" subshell whose first token has already been read
+static std::unique_ptr<Node> parse_subshell(const std::string &first, std::istringstream &iss) {
+    std::string body;
+    std::string token = first.substr(1);
+    int depth = 1;
+
+    while (true) {
+        for (char c : token) {
+            if (c == '(') {
+                depth++;
+            } else if (c == ')') {
+                depth--;
+            }
+        }
+
+        if (depth <= 0) {
+            // Drop the closing parenthesis
+            body += token.substr(0, token.size() - 1);
+            break;
+        }
+
+        body += token + " ";
+        if (!(iss >> token)) {
+            std::cerr << "kash: syntax error: missing ')'" << std::endl;
+            return nullptr;
+        }
+    }
+
+    return std::make_unique<SubshellNode>(parse_command(body));
+}
+
 std::unique_ptr<Node> parse_command(const std::string &input) {
     std::istringstream iss(input);
     std::vector<std::string> args;
     std::string token;
     std::unique_ptr<Node> current_node;
+    std::unique_ptr<Node> compound_node;
+    std::vector<std::pair<int, std::string>> redirections;
 
      while (iss >> token) {
+        // Arithmetic may contain spaces and operators, so keep reading until the parentheses close
+        int depth = arithmetic_depth(token);
+        std::string next;
+        while (depth > 0 && iss >> next) {
+            token += " " + next;
+            depth = arithmetic_depth(token);
+        }
+
         if (token == "&&" || token == "||" || token == "|" || token == ";") {
-            std::unique_ptr<Node> left_node;
-            if (is_builtin_command(args[0])) {
-                left_node = std::make_unique<BuiltinCommandNode>(args);
-            } else {
-                left_node = std::make_unique<CommandNode>(args);
-            }
+            std::unique_ptr<Node> left_node = finish_command(std::move(compound_node), args, redirections);
             args.clear(); // clear args for the right side
 
             std::unique_ptr<Node> right_node = parse_command(std::string(std::istreambuf_iterator<char>(iss), {}));
@@ -50,6 +187,35 @@ std::unique_ptr<Node> parse_command(const std::string &input) {
                 current_node = std::make_unique<SequenceNode>(std::move(left_node), std::move(right_node));
             }
             break; // Break after setting the right-hand side of the operator
+        } else if (redirect_type(token) != -1) {
+            std::string filename;
+            if (!(iss >> filename)) {
+                std::cerr << "kash: syntax error: missing file name after '" << token << "'" << std::endl;
+                return make_command_node({});
+            }
+            redirections.emplace_back(redirect_type(token), filename);
+        } else if (compound_node) {
+            std::cerr << "kash: syntax error near '" << token << "'" << std::endl;
+            return make_command_node({});
+        } else if (args.empty() && token[0] == '(' && token.compare(0, 2, "((") != 0) {
+            // ( ... )
+            compound_node = parse_subshell(token, iss);
+            if (!compound_node) {
+                return make_command_node({});
+            }
+        } else if (args.empty() && token.size() > 2 && token.compare(token.size() - 2, 2, "()") == 0) {
+            // name() { ... }
+            compound_node = parse_function_definition(token.substr(0, token.size() - 2), iss);
+            if (!compound_node) {
+                return make_command_node({});
+            }
+        } else if (args.size() == 1 && token == "()") {
+            // name () { ... }
+            compound_node = parse_function_definition(args[0], iss);
+            args.clear();
+            if (!compound_node) {
+                return make_command_node({});
+            }
         } else {
             // Not an operator, add to args
             args.push_back(token);
@@ -58,11 +224,7 @@ std::unique_ptr<Node> parse_command(const std::string &input) {
 
     // If there was no operator, create a command node with the collected args
     if (!current_node) {
-        if (is_builtin_command(args[0])) {
-            current_node = std::make_unique<BuiltinCommandNode>(args);
-        } else {
-            current_node = std::make_unique<CommandNode>(args);
-        }
+        current_node = finish_command(std::move(compound_node), args, redirections);
     } else if (!args.empty()) {
         // Finalize the current node with the last set of collected arguments
         // This will depend on the type of the current_node
@@ -0,0 +1,211 @@
+#include "transfer.hpp"
+#include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+// Largest amount to ask the kernel for in one call. Pipes limit each splice
+// to their capacity anyway, so this only matters for file to file copies.
+static const size_t chunk_size = 1 << 20;
+
+bool write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+static void read_write_loop(int in_fd, const std::vector<int> &out_fds, TransferResult &result) {
+    static char buffer[128 * 1024];
+
+    while (true) {
+        ssize_t bytes_read = read(in_fd, buffer, sizeof(buffer));
+        if (bytes_read == 0) {
+            return;
+        }
+        if (bytes_read == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            result.failed = true;
+            return;
+        }
+
+        for (int fd : out_fds) {
+            if (!write_all(fd, buffer, bytes_read)) {
+                result.failed = true;
+                return;
+            }
+        }
+        result.bytes += bytes_read;
+    }
+}
+
+#ifdef __linux__
+enum class KernelCopy { Splice, Sendfile, CopyFileRange };
+
+// Move data with one of the zero-copy syscalls. Returns false without having
+// moved anything if the kernel doesn't support this pair of descriptors, so
+// the caller can fall back to another method.
+static bool kernel_copy_loop(KernelCopy kind, int in_fd, int out_fd, TransferResult &result) {
+    while (true) {
+        ssize_t moved;
+        switch (kind) {
+            case KernelCopy::Splice:
+                moved = splice(in_fd, nullptr, out_fd, nullptr, chunk_size, SPLICE_F_MOVE | SPLICE_F_MORE);
+                break;
+            case KernelCopy::Sendfile:
+                moved = sendfile(out_fd, in_fd, nullptr, chunk_size);
+                break;
+            case KernelCopy::CopyFileRange:
+                moved = copy_file_range(in_fd, nullptr, out_fd, nullptr, chunk_size, 0);
+                break;
+        }
+
+        if (moved == 0) {
+            return true;
+        }
+        if (moved == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (result.bytes == 0 && (errno == EINVAL || errno == ENOSYS || errno == EXDEV || errno == EBADF || errno == EOPNOTSUPP)) {
+                return false;
+            }
+            result.failed = true;
+            return true;
+        }
+        result.bytes += moved;
+    }
+}
+#endif
+
+TransferResult transfer_fd(int in_fd, int out_fd) {
+    TransferResult result;
+
+#ifdef __linux__
+    struct stat in_stat, out_stat;
+    if (fstat(in_fd, &in_stat) == 0 && fstat(out_fd, &out_stat) == 0) {
+        if (S_ISFIFO(in_stat.st_mode) || S_ISFIFO(out_stat.st_mode)) {
+            // splice needs a pipe on at least one end
+            if (kernel_copy_loop(KernelCopy::Splice, in_fd, out_fd, result)) {
+                result.method = "splice";
+                return result;
+            }
+        } else if (S_ISREG(in_stat.st_mode) && S_ISREG(out_stat.st_mode)) {
+            if (kernel_copy_loop(KernelCopy::CopyFileRange, in_fd, out_fd, result)) {
+                result.method = "copy_file_range";
+                return result;
+            }
+        }
+
+        // sendfile can read from any file that supports mmap-like access
+        if (S_ISREG(in_stat.st_mode) && kernel_copy_loop(KernelCopy::Sendfile, in_fd, out_fd, result)) {
+            result.method = "sendfile";
+            return result;
+        }
+    }
+#endif
+
+    read_write_loop(in_fd, {out_fd}, result);
+    return result;
+}
+
+TransferResult tee_fd(int in_fd, int out_fd, const std::vector<int> &files) {
+    if (files.empty()) {
+        // Nothing to duplicate, so this is just a copy
+        return transfer_fd(in_fd, out_fd);
+    }
+
+    TransferResult result;
+
+#ifdef __linux__
+    // With pipes on both sides and a single file, tee(2) duplicates the data
+    // into the output pipe and splice then moves the original into the file
+    struct stat in_stat, out_stat;
+    if (files.size() == 1 && fstat(in_fd, &in_stat) == 0 && fstat(out_fd, &out_stat) == 0 &&
+            S_ISFIFO(in_stat.st_mode) && S_ISFIFO(out_stat.st_mode)) {
+        bool supported = true;
+        bool splice_to_file = true;
+
+        while (true) {
+            ssize_t copied = tee(in_fd, out_fd, chunk_size, 0);
+            if (copied == 0) {
+                break;
+            }
+            if (copied == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                supported = result.bytes != 0 || errno != EINVAL;
+                result.failed = supported;
+                break;
+            }
+
+            // Consume exactly what was duplicated. Files splice can't write to
+            // (opened with O_APPEND, for example) get it through a buffer instead.
+            ssize_t remaining = copied;
+            while (remaining > 0) {
+                ssize_t moved = -1;
+                if (splice_to_file) {
+                    moved = splice(in_fd, nullptr, files[0], nullptr, remaining, SPLICE_F_MOVE);
+                    if (moved == -1 && errno == EINVAL) {
+                        splice_to_file = false;
+                        continue;
+                    }
+                } else {
+                    static char buffer[64 * 1024];
+                    moved = read(in_fd, buffer, std::min<size_t>(remaining, sizeof(buffer)));
+                    if (moved > 0 && !write_all(files[0], buffer, moved)) {
+                        moved = -1;
+                    }
+                }
+
+                if (moved == -1 && errno == EINTR) {
+                    continue;
+                }
+                if (moved <= 0) {
+                    result.failed = true;
+                    return result;
+                }
+                remaining -= moved;
+            }
+            result.bytes += copied;
+        }
+
+        if (supported) {
+            result.method = "tee/splice";
+            return result;
+        }
+    }
+#endif
+
+    std::vector<int> out_fds = files;
+    out_fds.insert(out_fds.begin(), out_fd);
+    read_write_loop(in_fd, out_fds, result);
+    return result;
+}
+
+long set_pipe_capacity(int fd, long size) {
+#ifdef F_SETPIPE_SZ
+    return fcntl(fd, F_SETPIPE_SZ, size);
+#else
+    (void)fd;
+    (void)size;
+    return -1;
+#endif
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+
+// Moving bytes between file descriptors for builtins like cat and tee.
+//
+// On Linux these use splice, sendfile and copy_file_range so data that is
+// only being forwarded never gets copied through userspace. Everywhere else
+// (and whenever the kernel refuses a pair of descriptors) they fall back to
+// a plain read/write loop.
+
+struct TransferResult {
+    long long bytes = 0;
+    const char *method = "read/write"; // Which path actually moved the data
+    bool failed = false;
+};
+
+// Write all of data, retrying short and interrupted writes
+bool write_all(int fd, const char *data, size_t length);
+
+// Copy everything from in_fd to out_fd until end of file
+TransferResult transfer_fd(int in_fd, int out_fd);
+
+// Copy everything from in_fd to out_fd and to each of files. Only the common
+// cases avoid userspace: no files goes through transfer_fd, and a single file
+// between two pipes uses tee(2) plus splice. Writing to several files, or to
+// anything that isn't a pipe, falls back to the read/write loop.
+TransferResult tee_fd(int in_fd, int out_fd, const std::vector<int> &files);
+
+// Resize a pipe's kernel buffer. Returns the capacity actually set,
+// or -1 if it couldn't be changed on this system.
+long set_pipe_capacity(int fd, long size);
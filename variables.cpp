@@ -0,0 +1,97 @@
+#include "variables.hpp"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdlib>
+#include <cctype>
+
+static std::unordered_map<std::string, std::string> variables;
+static std::vector<std::string> positional;
+
+// A variable shadowed by a local, restored when its scope is popped
+struct SavedVariable {
+    std::string name;
+    std::string value;
+    bool was_set;
+};
+
+// Each scope is the list of variables it shadowed, in the order they were made local
+static std::vector<std::vector<SavedVariable>> scopes;
+
+const std::string *get_variable(const std::string &name) {
+    auto it = variables.find(name);
+    if (it != variables.end()) {
+        return &it->second;
+    }
+
+    // Not a shell variable, import it from the environment on first use
+    const char *env_value = getenv(name.c_str());
+    if (env_value == nullptr) {
+        return nullptr;
+    }
+
+    return &variables.emplace(name, env_value).first->second;
+}
+
+void set_variable(const std::string &name, const std::string &value) {
+    variables[name] = value;
+}
+
+bool is_valid_variable_name(const std::string &name) {
+    if (name.empty() || !(isalpha(static_cast<unsigned char>(name[0])) || name[0] == '_')) {
+        return false;
+    }
+
+    for (char c : name) {
+        if (!(isalnum(static_cast<unsigned char>(c)) || c == '_')) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool tracing_enabled() {
+    const std::string *trace = get_variable("KASH_TRACE");
+    return trace != nullptr && !trace->empty();
+}
+
+std::vector<std::string> &positional_parameters() {
+    return positional;
+}
+
+void push_variable_scope() {
+    scopes.emplace_back();
+}
+
+void pop_variable_scope() {
+    std::vector<SavedVariable> &scope = scopes.back();
+
+    // Restore in reverse so the oldest saved value wins
+    for (auto it = scope.rbegin(); it != scope.rend(); ++it) {
+        if (it->was_set) {
+            variables[it->name] = std::move(it->value);
+        } else {
+            variables.erase(it->name);
+        }
+    }
+
+    scopes.pop_back();
+}
+
+bool in_variable_scope() {
+    return !scopes.empty();
+}
+
+void make_local_variable(const std::string &name) {
+    std::vector<SavedVariable> &scope = scopes.back();
+    for (const auto &saved : scope) {
+        if (saved.name == name) {
+            // Already local in this scope
+            return;
+        }
+    }
+
+    const std::string *value = get_variable(name);
+    scope.push_back({name, value != nullptr ? *value : std::string(), value != nullptr});
+}
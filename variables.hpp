@@ -0,0 +1,30 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// Look up a shell variable, falling back to the environment.
+// Returns nullptr if the variable is not set anywhere.
+const std::string *get_variable(const std::string &name);
+
+// Set a shell variable, reusing the existing storage when the name is already set
+void set_variable(const std::string &name, const std::string &value);
+
+// Returns true if name is a valid variable name ([A-Za-z_][A-Za-z0-9_]*)
+bool is_valid_variable_name(const std::string &name);
+
+// Tracing is turned on by setting KASH_TRACE to anything but an empty string
+bool tracing_enabled();
+
+// Positional parameters ($1, $2, ...) of the running function or script.
+// Swapping them in and out is just a vector swap, so function calls stay cheap.
+std::vector<std::string> &positional_parameters();
+
+// Local variable scopes. A scope records the values that locals shadowed,
+// so lookups never have to walk a chain of scopes and returning from a
+// function just puts the saved values back.
+void push_variable_scope();
+void pop_variable_scope();
+bool in_variable_scope();
+
+// Make name local to the innermost scope (local builtin)
+void make_local_variable(const std::string &name);